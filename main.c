@@ -1,11 +1,39 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <math.h>
 #include "rngtest.h"
 
-int main(int argc, char *argv[]) {
+static void usage(char *prog) {
+    fprintf(stderr,
+        "usage: %s [-m m] [-d d] [-a alpha] [-c checkpoint [-k bits]] [-C cache] [file]\n"
+        "       %s [-m m] [-d d] [-s start] [-e end] [-c checkpoint [-k bits]] -p partial file\n"
+        "       %s [-a alpha] -M partial...\n"
+        "       %s [-a alpha] [-H entropy] [-D delta] -q file\n"
+        "  Without file, run the built-in examples. file may be gzip or zstd\n"
+        "  compressed when built with HAVE_ZLIB or HAVE_ZSTD.\n"
+        "  -s/-e test only bytes [start, end) of file; -p writes the raw counts there\n"
+        "  instead of results. -M merges partials covering the whole file, given in\n"
+        "  file order, into the results a single run over it would give.\n"
+        "  -q runs the sequential health tests and stops at the first failure,\n"
+        "  exiting 3. alpha is the false alarm rate per bit (per 1024-bit window\n"
+        "  for H2), default 2^-30; entropy, in bits per bit, defaults to 1; delta,\n"
+        "  the bias |p - 1/2| the monobit CUSUM looks for, defaults to 0.1.\n",
+        prog, prog, prog, prog);
+    exit(2);
+}
+
+/* Reason for the last failed read, in the terms of this program */
+static const char *reason(void) {
+    return (errno == EILSEQ) ? "not a sequence of 0 and 1 digits" : strerror(errno);
+}
+
+static int demo(double alpha) {
     bit    *s;                      // random binary sequence
+    bcd    *d;                      // random decimal sequence, packed
     long   n;                       // length
-    double alpha = 0.05;
     int    i;
 
     /// Menezes
@@ -22,17 +50,17 @@ int main(int argc, char *argv[]) {
     free(s);
 
     /// Decimal
-    s = read_sequence("data/randomDec.txt", &n);
+    d = read_sequence_dec("data/randomDec.txt", &n);
     printf("Decimal, n = %ld\n", n);
     test Y[5];
-    Y[0] = freq_dec(s, n, alpha);
-    Y[1] = serial_dec(s, n, alpha);
-    Y[2] = poker_dec(s, n, 3, alpha);
-    Y[3] = runs_dec(s, n, alpha);
-    Y[4] = autocorr_dec(s, n, 8, alpha);
+    Y[0] = freq_dec(d, n, alpha);
+    Y[1] = serial_dec(d, n, alpha);
+    Y[2] = poker_dec(d, n, 3, alpha);
+    Y[3] = runs_dec(d, n, alpha);
+    Y[4] = autocorr_dec(d, n, 8, alpha);
     for (i = 0; i < 5; i++)
         printf("Y%d = %10g\t%s\n", i+1, Y[i].val, status_str[Y[i].stat]);
-    free(s);
+    free(d);
 
     /// FIPS
     s = fips_read_sequence("data/e.txt");
@@ -48,3 +76,133 @@ int main(int argc, char *argv[]) {
 
     return 0;
 }
+
+int main(int argc, char *argv[]) {
+    double alpha = 0.05, H = 1.0, delta = 0.1;
+    long   m = 3, d = 8;            // poker block length, autocorr shift
+    long   every = 1L << 24;        // bits between checkpoints
+    long   start = 0, end = -1;     // byte range of file
+    long   n;
+    char   *ckpt = NULL, *cache = NULL, *part = NULL, *file;
+    char   label[64];
+    unsigned long long h = 0, id = 0;     // content hash, file identity
+    stream *T, *U;
+    health *Q;
+    test   X[5];
+    int    opt, i, merge = 0, seq = 0, alpha_set = 0;
+
+    while ((opt = getopt(argc, argv, "m:d:a:c:k:C:s:e:p:MqH:D:")) != -1) {
+        switch (opt) {
+        case 'm': m     = atol(optarg); break;
+        case 'd': d     = atol(optarg); break;
+        case 'a': alpha = atof(optarg); alpha_set = 1; break;
+        case 'c': ckpt  = optarg;       break;
+        case 'k': every = atol(optarg); break;
+        case 'C': cache = optarg;       break;
+        case 's': start = atol(optarg); break;
+        case 'e': end   = atol(optarg); break;
+        case 'p': part  = optarg;       break;
+        case 'M': merge = 1;            break;
+        case 'q': seq   = 1;            break;
+        case 'H': H     = atof(optarg); break;
+        case 'D': delta = atof(optarg); break;
+        default:  usage(argv[0]);
+        }
+    }
+    if (m < 1 || m > STREAM_MMAX || d < 1 || d > STREAM_DMAX || every < 1 || start < 0 || H <= 0 || H > 1)
+        usage(argv[0]);
+    if ((merge || seq) && (part || ckpt || cache || start != 0 || end >= 0))
+        usage(argv[0]);
+    if (merge && seq)
+        usage(argv[0]);
+    if (optind == argc)
+        return (merge || seq) ? (usage(argv[0]), 2) : demo(alpha);
+    file = argv[optind];
+
+    if (seq) {
+        if (!alpha_set)
+            alpha = ldexp(1, -30);
+        if (!(0 < alpha && alpha < 0.5) || !(0 < delta && delta < 0.5))
+            usage(argv[0]);
+        Q = health_file(file, alpha, H, delta);
+        if (!Q) {
+            fprintf(stderr, "%s: %s: %s\n", argv[0], file, reason());
+            return 1;
+        }
+        health_result(Q, X);
+        printf("%s, n = %ld\n", file, Q->N);
+        for (i = 0; i < 3; i++)
+            printf("H%d = %10g\t%s\n", i+1, X[i].val, status_str[X[i].stat]);
+        free(Q);
+        return (X[0].stat == FAIL || X[1].stat == FAIL || X[2].stat == FAIL) ? 3 : 0;
+    }
+
+    if (merge) {
+        T = NULL;
+        for (i = optind; i < argc; i++) {
+            U = stream_load(argv[i]);
+            if (!U || (T && stream_merge(T, U) != 0)) {
+                fprintf(stderr, "%s: bad or mismatched partial %s\n", argv[0], argv[i]);
+                stream_free(T);
+                stream_free(U);
+                return 1;
+            }
+            if (!T)
+                T = U;
+            else
+                stream_free(U);
+        }
+        if (T->start != 0 || T->end >= 0) {
+            fprintf(stderr, "%s: partials do not cover the whole file\n", argv[0]);
+            stream_free(T);
+            return 1;
+        }
+        snprintf(label, sizeof(label), "Merged %d partials", argc - optind);
+        file = label;
+        goto result;
+    }
+
+    if (part || ckpt)
+        id = file_id(file);
+    if (cache && start == 0 && end < 0)
+        h = hash_file(file);
+
+    if (part) {
+        T = stream_file(file, m, d, start, end, id, ckpt, every);
+        if (!T || stream_save(T, part) != 0) {
+            fprintf(stderr, "%s: cannot read %s or write %s: %s\n", argv[0], file, part, reason());
+            return 1;
+        }
+        stream_free(T);
+        if (ckpt)
+            remove(ckpt);
+        return 0;
+    }
+
+    if (cache && start == 0 && end < 0 && h && cache_lookup(cache, h, m, d, alpha, &n, X))
+        goto print;
+
+    T = stream_file(file, m, d, start, end, id, ckpt, every);
+    if (!T) {
+        if (ckpt)
+            fprintf(stderr, "%s: cannot read %s or write %s: %s\n", argv[0], file, ckpt, reason());
+        else
+            fprintf(stderr, "%s: %s: %s\n", argv[0], file, reason());
+        return 1;
+    }
+    if (ckpt)
+        remove(ckpt);
+
+result:
+    n = T->N;
+    stream_result(T, alpha, X);
+    stream_free(T);
+    if (cache && start == 0 && end < 0 && h)
+        cache_store(cache, h, m, d, alpha, n, X);
+
+print:
+    printf("%s, n = %ld\n", file, n);
+    for (i = 0; i < 5; i++)
+        printf("X%d = %10g\t%s\n", i+1, X[i].val, status_str[X[i].stat]);
+    return 0;
+}
@@ -8,8 +8,15 @@
 #define RNGTEST_H_INCLUDED
 
 #define FIPS_N  20000
+#define RUN_MAX 64              /* longest run kept by the streaming runs test */
+#define STREAM_MMAX 16          /* largest poker block length of a stream */
+#define STREAM_DMAX (1L << 24) /* largest autocorr shift of a stream */
+#define APT_W   1024            /* adaptive proportion window for bits (SP 800-90B) */
 
 typedef unsigned char bit;
+typedef struct bcd {            /* two decimal digits, high nibble first */
+    unsigned char b;
+} bcd;
 
 typedef enum status {
     PASS,
@@ -30,8 +37,42 @@ typedef struct test {
     status stat;
 } test;
 
+/* Accumulated state of the five basic tests over a sequence read in pieces */
+typedef struct stream {
+    long    m, d, w;            // poker block length, autocorr shift, max(d, m-1)
+    long    N;                  // bits consumed so far
+    long    off;                // input byte offset after the last bit
+    long    start, end;         // input byte range, end < 0: to the end of file
+    long    size;               // input file size
+    unsigned long long id;      // input file identity, see file_id
+    long    n[2];               // bit counts
+    long    nn[2][2];           // overlapping pair counts
+    long    *P;                 // poker bins by block start mod m, m x 2^m
+    long    val;                // last m-1 bits
+    long    B[RUN_MAX];         // closed blocks by length, first run excluded
+    long    G[RUN_MAX];         // closed gaps by length, first run excluded
+    long    h;                  // length of the first run
+    long    prev, count;        // last run, still open
+    long    A;                  // autocorr disagreements
+    bit     *F;                 // first w bits
+    bit     *H;                 // last w bits, ring buffer
+} stream;
+
+/* Sequential health tests, stopped at the first failure */
+typedef struct health {
+    long    rct_c, apt_c;       // repetition count and adaptive proportion cutoffs
+    double  up;                 // CUSUM threshold on the log-likelihood ratio
+    double  inc[2];             // CUSUM increment for a bit agreeing / disagreeing with the bias
+    long    N;                  // bits consumed
+    long    prev, count, maxrun;
+    long    ref, pos, same, maxsame;    // adaptive proportion window
+    double  L[2], Lmax;         // CUSUM statistics for bias towards 0 and 1
+    status  st[3];
+} health;
+
 bit *read_sequence(char *filename, long *N);
 bit *fips_read_sequence(char *filename);
+bcd *read_sequence_dec(char *filename, long *N);
 
 /* Five basic tests (Menezes et al. 1996. Handbook of Applied Cryptography. pp 181-183) */
 test freq     (bit *S, long N, double alpha);
@@ -41,11 +82,34 @@ test runs     (bit *S, long N, double alpha);
 test autocorr (bit *S, long N, long d, double alpha);
 
 /* Five basic tests (decimal digit) */
-test freq_dec    (bit *S, long N, double alpha);
-test serial_dec  (bit *S, long N, double alpha);
-test poker_dec   (bit *S, long N, long m, double alpha);
-test runs_dec    (bit *S, long N, double alpha);
-test autocorr_dec(bit *S, long N, long d, double alpha);
+test freq_dec    (bcd *S, long N, double alpha);
+test serial_dec  (bcd *S, long N, double alpha);
+test poker_dec   (bcd *S, long N, long m, double alpha);
+test runs_dec    (bcd *S, long N, double alpha);
+test autocorr_dec(bcd *S, long N, long d, double alpha);
+
+/* Five basic tests, incremental with checkpoint and merge */
+stream *stream_new   (long m, long d);
+void    stream_free  (stream *T);
+void    stream_update(stream *T, bit *S, long n);
+int     stream_merge (stream *T, stream *B);
+void    stream_result(stream *T, double alpha, test X[5]);
+int     stream_save  (stream *T, char *filename);
+stream *stream_load  (char *filename);
+stream *stream_file  (char *filename, long m, long d, long start, long end,
+                      unsigned long long id, char *ckpt, long every);
+
+/* Sequential health tests (NIST SP 800-90B 4.4, Page CUSUM on monobit bias) */
+health *health_new   (double alpha, double H, double delta);
+long    health_update(health *M, bit *S, long n);
+void    health_result(health *M, test X[3]);
+health *health_file  (char *filename, double alpha, double H, double delta);
+
+/* Result cache keyed by file content, and a cheaper file identity */
+unsigned long long hash_file(char *filename);
+unsigned long long file_id  (char *filename);
+int  cache_lookup(char *cache, unsigned long long h, long m, long d, double alpha, long *N, test X[5]);
+void cache_store (char *cache, unsigned long long h, long m, long d, double alpha, long N, test X[5]);
 
 /* FIPS 140-1 tests */
 test fips_monobit (bit *S);
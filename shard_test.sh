@@ -0,0 +1,73 @@
+#!/bin/sh
+#
+# Check that merging -p shards gives exactly the results of a single run.
+# Splits each binary file in data/ at random and fixed byte offsets, runs the
+# shards as parallel local processes, and compares `main -M` with `main file`.
+#
+# usage: ./shard_test.sh [shards per split]
+
+cd "$(dirname "$0")" || exit 1
+CC=${CC:-cc}
+K=${1:-8}
+TMP=$(mktemp -d) || exit 1
+trap 'rm -rf "$TMP"' EXIT
+fail=0
+
+$CC -O2 -o "$TMP/main" main.c rngtest.c -lm || exit 1
+
+# sorted, unique cut points in (0, size): fixed ones near the ends plus random
+cuts() {
+    awk -v size="$1" -v k="$2" -v seed="$3" 'BEGIN {
+        srand(seed);
+        c[1] = 1; c[2] = 2; c[size-1] = 1;
+        for (i = 0; i < k; i++) c[int(rand() * size)] = 1;
+        for (x in c) if (x > 0 && x < size) print x;
+    }' | sort -n
+}
+
+check() {   # file m d seed
+    file=$1; m=$2; d=$3; seed=$4
+    size=$(wc -c < "$file")
+    prev=0; i=0; parts=""
+    for c in $(cuts "$size" "$K" "$seed") ""; do
+        end=${c:+-e $c}
+        "$TMP/main" -m "$m" -d "$d" -s "$prev" $end -p "$TMP/part.$i" "$file" &
+        parts="$parts $TMP/part.$i"
+        prev=${c:-$size}; i=$((i+1))
+    done
+    wait
+    # an empty shard at the end of the file must merge as well
+    "$TMP/main" -m "$m" -d "$d" -s "$size" -p "$TMP/part.$i" "$file"
+    parts="$parts $TMP/part.$i"
+
+    "$TMP/main" -M $parts | sed 1d > "$TMP/merged"
+    "$TMP/main" -m "$m" -d "$d" "$file" | sed 1d > "$TMP/single"
+    if ! cmp -s "$TMP/merged" "$TMP/single"; then
+        echo "FAIL $file m=$m d=$d seed=$seed"
+        fail=1
+    fi
+
+    # out of order and incomplete sets must be rejected
+    set -- $parts
+    if [ $# -ge 2 ] && "$TMP/main" -M "$2" "$1" > /dev/null 2>&1; then
+        echo "FAIL $file: swapped partials accepted"
+        fail=1
+    fi
+    shift
+    if "$TMP/main" -M "$@" > /dev/null 2>&1; then
+        echo "FAIL $file: partials without the first shard accepted"
+        fail=1
+    fi
+    rm -f "$TMP"/part.*
+}
+
+for file in data/basic.txt data/e.txt data/pi.txt data/sqrt2.txt data/sqrt3.txt; do
+    for md in "3 8" "1 1" "4 1" "2 100" "6 2"; do
+        for seed in 1 2; do
+            check "$file" $md $seed
+        done
+    done
+done
+
+[ $fail -eq 0 ] && echo "shard_test: all merges exact"
+exit $fail